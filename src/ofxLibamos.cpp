@@ -0,0 +1,449 @@
+#include "ofxLibamos.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+    bool hasTag(const ofJson& msg, const char* tag) {
+        auto tags = msg.find("tags");
+        if (tags == msg.end() || !tags->is_array()) {
+            return false;
+        }
+        for (const ofJson& t : *tags) {
+            if (t.is_string() && t.get_ref<const std::string&>() == tag) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Leaves value unchanged unless key holds a number; a JS NaN arrives as null.
+    // Returns whether value changed.
+    template <typename T>
+    bool readNumber(const ofJson& obj, const char* key, T& value) {
+        auto it = obj.find(key);
+        if (it == obj.end() || !it->is_number()) {
+            return false;
+        }
+        T next = it->get<T>();
+        if (next == value) {
+            return false;
+        }
+        value = next;
+        return true;
+    }
+}
+
+std::atomic<bool> ofxLibamos::instanceActive{false};
+
+ofxLibamos::ofxLibamos() {
+}
+
+ofxLibamos::~ofxLibamos() {
+    close();
+}
+
+int ofxLibamos::setup(const std::string& workingDir, const std::string& modulesDir, const std::string& motherEndpoint, int logLevel) {
+    if (created) {
+        ofLogWarning("ofxLibamos") << "setup(): already set up, call close() first";
+        return -1;
+    }
+    bool expected = false;
+    if (!instanceActive.compare_exchange_strong(expected, true)) {
+        ofLogError("ofxLibamos") << "setup(): another ofxLibamos instance owns the AMOS singleton";
+        return -1;
+    }
+
+    // Forget the previous session; the worker is not running yet, so this thread is the only writer
+    latestSnapshot = ofxLibamosSnapshot();
+    snapshots.write(latestSnapshot);
+
+    incoming.reset(new ofThreadChannel<std::string>());
+    worker = std::thread(&ofxLibamos::threadedFunction, this);
+
+    int res = amos_create(workingDir.c_str(), modulesDir.empty() ? nullptr : modulesDir.c_str(), motherEndpoint.c_str(), 0, 0, logLevel);
+    if (res != 0) {
+        ofLogError("ofxLibamos") << "setup(): amos_create failed with " << res;
+        stopWorker();
+        instanceActive = false;
+        return res;
+    }
+
+    amos_set_msg_object_callback(this, &ofxLibamos::onAmosMessage);
+    created = true;
+    return res;
+}
+
+void ofxLibamos::close() {
+    if (!created) {
+        return;
+    }
+    amos_destroy();
+    created = false;
+
+    stopWorker();
+    abandonPendingRequests();
+    instanceActive = false;
+}
+
+void ofxLibamos::stopWorker() {
+    incoming->close();
+    if (worker.joinable()) {
+        worker.join();
+    }
+    incoming.reset();
+}
+
+bool ofxLibamos::isSetup() const {
+    return created;
+}
+
+size_t ofxLibamos::getNumPendingRequests() const {
+    return numPending.load(std::memory_order_relaxed);
+}
+
+std::future<ofJson> ofxLibamos::request(const std::function<void(long)>& issue, ResponseCallback callback) {
+    if (!created) {
+        std::promise<ofJson> failed;
+        failed.set_exception(std::make_exception_ptr(std::runtime_error("ofxLibamos: request made before setup()")));
+        return failed.get_future();
+    }
+
+    long requestId = nextRequestId.fetch_add(1, std::memory_order_relaxed);
+    PendingRequest* slot = nullptr;
+    for (size_t i = 0; i < MAX_PENDING_REQUESTS; ++i) {
+        PendingRequest& candidate = pending[(requestId + i) % MAX_PENDING_REQUESTS];
+        if (candidate.id.load(std::memory_order_acquire) == 0) {
+            slot = &candidate;
+            break;
+        }
+    }
+    if (slot == nullptr) {
+        std::promise<ofJson> failed;
+        failed.set_exception(std::make_exception_ptr(std::runtime_error("ofxLibamos: too many pending requests")));
+        return failed.get_future();
+    }
+
+    slot->promise = std::promise<ofJson>();
+    slot->callback = std::move(callback);
+    slot->issued = std::chrono::steady_clock::now();
+    std::future<ofJson> future = slot->promise.get_future();
+    numPending.fetch_add(1, std::memory_order_relaxed);
+    slot->id.store(requestId, std::memory_order_release);
+
+    issue(requestId);
+    return future;
+}
+
+bool ofxLibamos::resolve(long requestId, const ofJson& response) {
+    if (requestId <= 0) {
+        return false;
+    }
+    PendingRequest* match = nullptr;
+    for (size_t i = 0; i < MAX_PENDING_REQUESTS; ++i) {
+        PendingRequest& candidate = pending[(requestId + i) % MAX_PENDING_REQUESTS];
+        if (candidate.id.load(std::memory_order_acquire) == requestId) {
+            match = &candidate;
+            break;
+        }
+    }
+    // Lost to cancelRequestsOlderThan if it claimed the slot first
+    long expected = requestId;
+    if (match == nullptr || !match->id.compare_exchange_strong(expected, CLAIMED_REQUEST, std::memory_order_acq_rel)) {
+        return false;
+    }
+
+    PendingRequest& slot = *match;
+
+    std::promise<ofJson> promise = std::move(slot.promise);
+    ResponseCallback callback = std::move(slot.callback);
+    slot.callback = nullptr;
+    numPending.fetch_sub(1, std::memory_order_relaxed);
+    slot.id.store(0, std::memory_order_release);
+
+    promise.set_value(response);
+    if (callback) {
+        try {
+            callback(response);
+        } catch (const std::exception& e) {
+            ofLogError("ofxLibamos") << "response callback for request " << requestId << " threw: " << e.what();
+        }
+    }
+    return true;
+}
+
+size_t ofxLibamos::cancelRequestsOlderThan(std::chrono::milliseconds maxAge) {
+    auto now = std::chrono::steady_clock::now();
+    size_t cancelled = 0;
+    for (PendingRequest& slot : pending) {
+        long id = slot.id.load(std::memory_order_acquire);
+        if (id <= 0 || now - slot.issued < maxAge) {
+            continue;
+        }
+        if (!slot.id.compare_exchange_strong(id, CLAIMED_REQUEST, std::memory_order_acq_rel)) {
+            continue;
+        }
+        slot.promise.set_exception(std::make_exception_ptr(std::runtime_error("ofxLibamos: request " + std::to_string(id) + " timed out")));
+        slot.callback = nullptr;
+        numPending.fetch_sub(1, std::memory_order_relaxed);
+        slot.id.store(0, std::memory_order_release);
+        cancelled++;
+    }
+    return cancelled;
+}
+
+void ofxLibamos::abandonPendingRequests() {
+    for (PendingRequest& slot : pending) {
+        if (slot.id.load(std::memory_order_acquire) != 0) {
+            // Replacing the promise breaks the future held by the caller
+            slot.promise = std::promise<ofJson>();
+            slot.callback = nullptr;
+            slot.id.store(0, std::memory_order_release);
+        }
+    }
+    numPending = 0;
+}
+
+ofxLibamosSnapshot ofxLibamos::getSnapshot() {
+    return snapshots.read();
+}
+
+void ofxLibamos::updateSnapshot(const ofJson& msg) {
+    bool changed = false;
+    if (hasTag(msg, "transport")) {
+        auto result = msg.find("result");
+        if (result == msg.end() || !result->is_object()) {
+            return;
+        }
+        changed |= readNumber(*result, "beat", latestSnapshot.beat);
+        changed |= readNumber(*result, "tempo", latestSnapshot.tempo);
+        changed |= readNumber(*result, "seconds", latestSnapshot.seconds);
+        changed |= readNumber(*result, "frame", latestSnapshot.frame);
+    } else if (hasTag(msg, "rms")) {
+        changed |= readNumber(msg, "beat", latestSnapshot.rmsBeat);
+        for (int group = 0; group < OFXLIBAMOS_NUM_GROUPS; ++group) {
+            changed |= readNumber(msg, std::to_string(group).c_str(), latestSnapshot.rms[group]);
+        }
+    } else if (hasTag(msg, "playing") && hasTag(msg, "section")) {
+        auto result = msg.find("result");
+        if (result == msg.end() || !result->is_string()) {
+            return;
+        }
+        const char* section = result->get_ref<const std::string&>().c_str();
+        if (strncmp(latestSnapshot.section, section, OFXLIBAMOS_SECTION_KEY_SIZE - 1) != 0) {
+            strncpy(latestSnapshot.section, section, OFXLIBAMOS_SECTION_KEY_SIZE - 1);
+            latestSnapshot.section[OFXLIBAMOS_SECTION_KEY_SIZE - 1] = '\0';
+            changed = true;
+        }
+    }
+    if (!changed) {
+        return;
+    }
+
+    latestSnapshot.sequence++;
+    snapshots.write(latestSnapshot);
+}
+
+void ofxLibamos::addMessageFilter(const std::string& tag) {
+    std::lock_guard<std::mutex> lock(filterMutex);
+    filterTags.insert(tag);
+}
+
+void ofxLibamos::removeMessageFilter(const std::string& tag) {
+    std::lock_guard<std::mutex> lock(filterMutex);
+    filterTags.erase(tag);
+}
+
+void ofxLibamos::clearMessageFilters() {
+    std::lock_guard<std::mutex> lock(filterMutex);
+    filterTags.clear();
+}
+
+bool ofxLibamos::passesFilters(const ofJson& msg) {
+    std::lock_guard<std::mutex> lock(filterMutex);
+    if (filterTags.empty()) {
+        return true;
+    }
+    auto tags = msg.find("tags");
+    if (tags == msg.end() || !tags->is_array()) {
+        return false;
+    }
+    for (const ofJson& t : *tags) {
+        if (t.is_string() && filterTags.count(t.get_ref<const std::string&>()) > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ofxLibamos::setMessagePolling(bool enabled, size_t maxQueued) {
+    std::lock_guard<std::mutex> lock(pollMutex);
+    polling = enabled;
+    maxPolled = std::max<size_t>(maxQueued, 1);
+    if (!polling) {
+        polled.clear();
+    }
+    while (polled.size() > maxPolled) {
+        polled.pop_front();
+        droppedMessages++;
+    }
+}
+
+size_t ofxLibamos::pollMessages(std::vector<ofJson>& messages, size_t maxMessages) {
+    std::lock_guard<std::mutex> lock(pollMutex);
+    size_t count = std::min(maxMessages, polled.size());
+    for (size_t i = 0; i < count; ++i) {
+        messages.push_back(std::move(polled.front()));
+        polled.pop_front();
+    }
+    return count;
+}
+
+uint64_t ofxLibamos::getNumDroppedMessages() const {
+    return droppedMessages.load(std::memory_order_relaxed);
+}
+
+void ofxLibamos::queueMessage(const ofJson& msg) {
+    std::lock_guard<std::mutex> lock(pollMutex);
+    if (!polling) {
+        return;
+    }
+    if (polled.size() >= maxPolled) {
+        polled.pop_front();
+        droppedMessages++;
+    }
+    polled.push_back(msg);
+}
+
+void ofxLibamos::threadedFunction() {
+    std::string msg;
+    while (incoming->receive(msg)) {
+        // One bad message or throwing listener must not take down the worker
+        try {
+            dispatch(msg);
+        } catch (const std::exception& e) {
+            ofLogError("ofxLibamos") << "error handling message: " << e.what() << ": " << msg;
+        } catch (...) {
+            ofLogError("ofxLibamos") << "unknown error handling message: " << msg;
+        }
+    }
+}
+
+void ofxLibamos::dispatch(const std::string& msg) {
+    ofJson json = ofJson::parse(msg, nullptr, false);
+    if (json.is_discarded()) {
+        ofLogWarning("ofxLibamos") << "could not parse message: " << msg;
+        return;
+    }
+
+    if (json.is_object()) {
+        updateSnapshot(json);
+        auto it = json.find("request");
+        if (it != json.end() && it->is_number_integer() && resolve(it->get<long>(), json)) {
+            return;
+        }
+    }
+    if (!passesFilters(json)) {
+        return;
+    }
+    // Queue first, so a throwing listener cannot keep the message from pollMessages
+    queueMessage(json);
+    ofNotifyEvent(messageReceived, json);
+}
+
+void ofxLibamos::onAmosMessage(void* object, const char* msg) {
+    // Runs on an aimiscript process thread, so just copy the message out
+    ofxLibamos* self = static_cast<ofxLibamos*>(object);
+    if (msg != nullptr && self->incoming) {
+        self->incoming->send(std::string(msg));
+    }
+}
+
+std::future<ofJson> ofxLibamos::cacheExperienceList(ResponseCallback callback) {
+    return request([](long id) { amos_cache_experience_list(id); }, std::move(callback));
+}
+
+std::future<ofJson> ofxLibamos::cacheArtistList(ResponseCallback callback) {
+    return request([](long id) { amos_cache_artist_list(id); }, std::move(callback));
+}
+
+std::future<ofJson> ofxLibamos::cacheExperienceMetadata(long experienceId, ResponseCallback callback) {
+    return request([=](long id) { amos_cache_experience_metadata(id, experienceId); }, std::move(callback));
+}
+
+std::future<ofJson> ofxLibamos::getAllExperiences(bool force, ResponseCallback callback) {
+    return request([=](long id) { amos_experiences_get_all_async(id, force); }, std::move(callback));
+}
+
+std::future<ofJson> ofxLibamos::getExperience(long experienceId, bool force, ResponseCallback callback) {
+    return request([=](long id) { amos_experiences_get_async(id, experienceId, force); }, std::move(callback));
+}
+
+std::future<ofJson> ofxLibamos::getExperienceThemeCount(long experienceId, ResponseCallback callback) {
+    return request([=](long id) { amos_experiences_get_theme_count_async(id, experienceId); }, std::move(callback));
+}
+
+std::future<ofJson> ofxLibamos::getExperiencePlayCount(long experienceId, ResponseCallback callback) {
+    return request([=](long id) { amos_experiences_get_play_count_async(id, experienceId); }, std::move(callback));
+}
+
+std::future<ofJson> ofxLibamos::getAllArtists(bool force, ResponseCallback callback) {
+    return request([=](long id) { amos_artists_get_all_async(id, force); }, std::move(callback));
+}
+
+std::future<ofJson> ofxLibamos::getArtist(long artistId, bool force, ResponseCallback callback) {
+    return request([=](long id) { amos_artists_get_async(id, artistId, force); }, std::move(callback));
+}
+
+std::future<ofJson> ofxLibamos::getDiskUsage(ResponseCallback callback) {
+    return request([](long id) { amos_get_disk_usage_async(id); }, std::move(callback));
+}
+
+std::future<ofJson> ofxLibamos::getScoreSliders(ResponseCallback callback) {
+    return request([](long id) { amos_get_score_sliders_async(id); }, std::move(callback));
+}
+
+std::future<ofJson> ofxLibamos::getScoreSliderValue(long sliderId, ResponseCallback callback) {
+    return request([=](long id) { amos_get_score_slider_value_async(id, sliderId); }, std::move(callback));
+}
+
+std::future<ofJson> ofxLibamos::getCurrentlyPlayingThemes(ResponseCallback callback) {
+    return request([](long id) { amos_score_currently_playing_themes_async(id); }, std::move(callback));
+}
+
+std::future<ofJson> ofxLibamos::getCurrentlyPlayingSection(ResponseCallback callback) {
+    return request([](long id) { amos_score_currently_playing_section_async(id); }, std::move(callback));
+}
+
+std::future<ofJson> ofxLibamos::getCurrentlyPlayingExperience(ResponseCallback callback) {
+    return request([](long id) { amos_score_currently_playing_experience_async(id); }, std::move(callback));
+}
+
+std::future<ofJson> ofxLibamos::getSystemSliders(ResponseCallback callback) {
+    return request([](long id) { amos_get_system_sliders_async(id); }, std::move(callback));
+}
+
+std::future<ofJson> ofxLibamos::getSystemSliderValue(const std::string& name, ResponseCallback callback) {
+    return request([&](long id) { amos_get_system_slider_value_async(id, name.c_str()); }, std::move(callback));
+}
+
+std::future<ofJson> ofxLibamos::getLocalThemeCount(long experienceId, ResponseCallback callback) {
+    return request([=](long id) { amos_local_theme_count_async(id, experienceId); }, std::move(callback));
+}
+
+std::future<ofJson> ofxLibamos::getLocalThemeCounts(ResponseCallback callback) {
+    return request([](long id) { amos_local_theme_counts_async(id); }, std::move(callback));
+}
+
+std::future<ofJson> ofxLibamos::downloadUserPreferences(ResponseCallback callback) {
+    return request([](long id) { amos_download_user_preferences_async(id); }, std::move(callback));
+}
+
+std::future<ofJson> ofxLibamos::uploadUserPreferences(ResponseCallback callback) {
+    return request([](long id) { amos_upload_user_preferences_async(id); }, std::move(callback));
+}
+
+std::future<ofJson> ofxLibamos::getUserPreference(const std::string& keyPath, ResponseCallback callback) {
+    return request([&](long id) { amos_get_user_preference_async(id, keyPath.c_str()); }, std::move(callback));
+}
@@ -1,3 +1,214 @@
+#pragma once
+
 #define WITH_EXTERNAL_SINK
 
+#include "ofMain.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include "amos.h"
+#include "ofxLibamosRender.h"
+#include "ofxLibamosSnapshot.h"
+#include "ofxLibamosSoundOutput.h"
+
+/**
+ * @brief C++ owner of the libAMOS singleton
+ * @details ofxLibamos wraps amos_create/amos_destroy and turns the request/response style *_async
+ * calls of the C API into futures. Each request method allocates a request id, issues the matching
+ * amos_*_async call and returns a std::future that is fulfilled with the parsed response object,
+ * e.g. { tags: ['response', 'playing', 'section'], request: id, result: sectionKey }.
+ *
+ * Messages posted by libAMOS are copied off the aimiscript process thread straight away, and parsed
+ * and dispatched on a worker thread owned by this class. Optional response callbacks and the
+ * messageReceived event (for messages that are not responses to a pending request, such as
+ * transport or rms messages) therefore run on that worker thread, never on an aimiscript thread.
+ * Those messages can instead be collected in batches with pollMessages, and narrowed down by tag
+ * with addMessageFilter.
+ *
+ * As with the C API, setup and every request method must be called from the same thread.
+ * Only one ofxLibamos may be set up at a time, since libAMOS itself is a singleton.
+ */
+class ofxLibamos {
+public:
+    typedef std::function<void(const ofJson&)> ResponseCallback;
+
+    /// Maximum number of requests that may be awaiting a response at once
+    static const size_t MAX_PENDING_REQUESTS = 256;
+
+    ofxLibamos();
+    ~ofxLibamos();
+
+    ofxLibamos(const ofxLibamos&) = delete;
+    ofxLibamos& operator=(const ofxLibamos&) = delete;
+
+    /**
+     * @brief Create the AMOS singleton and start the response worker
+     *
+     * Arguments are as for amos_create. An empty modulesDir passes NULL, so that the inlined modules are used.
+     * Messages are delivered through amos_set_msg_object_callback, so no post office port is opened.
+     *
+     * @return the result of amos_create (0 on success, otherwise an error), or -1 if another ofxLibamos is
+     * already set up. On failure the worker is stopped and the object stays un-set-up, so setup may be retried.
+     */
+    int setup(const std::string& workingDir, const std::string& modulesDir, const std::string& motherEndpoint, int logLevel = 2);
+
+    /**
+     * @brief Destroy the AMOS singleton and stop the response worker
+     *
+     * Futures for requests still awaiting a response are abandoned (they throw std::future_error with broken_promise).
+     * Any ofxLibamosSoundOutput rendering this engine must be stopped first.
+     */
+    void close();
+
+    bool isSetup() const;
+
+    /// Number of requests issued through this object that are still awaiting a response
+    size_t getNumPendingRequests() const;
+
+    /**
+     * @brief Give up on requests that have been awaiting a response for at least maxAge
+     *
+     * A request whose response never arrives otherwise holds its slot until close. The futures of cancelled
+     * requests throw std::runtime_error and their callbacks are not called; a response that arrives later is
+     * treated as an ordinary message. Call from the same thread as the request methods, e.g. once per update().
+     *
+     * @return the number of requests cancelled
+     */
+    size_t cancelRequestsOlderThan(std::chrono::milliseconds maxAge);
+
+    /**
+     * @name Requests
+     * Each of these wraps the corresponding amos_*_async call. The returned future is fulfilled with the full
+     * response object. If a callback is given it is also called with the response, on the worker thread.
+     * If MAX_PENDING_REQUESTS requests are already awaiting a response, the returned future holds a std::runtime_error.
+     * A request whose response never arrives keeps its slot until close().
+     */
+    ///@{
+    std::future<ofJson> cacheExperienceList(ResponseCallback callback = nullptr);
+    std::future<ofJson> cacheArtistList(ResponseCallback callback = nullptr);
+    std::future<ofJson> cacheExperienceMetadata(long experienceId, ResponseCallback callback = nullptr);
+    std::future<ofJson> getAllExperiences(bool force = false, ResponseCallback callback = nullptr);
+    std::future<ofJson> getExperience(long experienceId, bool force = false, ResponseCallback callback = nullptr);
+    std::future<ofJson> getExperienceThemeCount(long experienceId, ResponseCallback callback = nullptr);
+    std::future<ofJson> getExperiencePlayCount(long experienceId, ResponseCallback callback = nullptr);
+    std::future<ofJson> getAllArtists(bool force = false, ResponseCallback callback = nullptr);
+    std::future<ofJson> getArtist(long artistId, bool force = false, ResponseCallback callback = nullptr);
+    std::future<ofJson> getDiskUsage(ResponseCallback callback = nullptr);
+    std::future<ofJson> getScoreSliders(ResponseCallback callback = nullptr);
+    std::future<ofJson> getScoreSliderValue(long sliderId, ResponseCallback callback = nullptr);
+    std::future<ofJson> getCurrentlyPlayingThemes(ResponseCallback callback = nullptr);
+    std::future<ofJson> getCurrentlyPlayingSection(ResponseCallback callback = nullptr);
+    std::future<ofJson> getCurrentlyPlayingExperience(ResponseCallback callback = nullptr);
+    std::future<ofJson> getSystemSliders(ResponseCallback callback = nullptr);
+    std::future<ofJson> getSystemSliderValue(const std::string& name, ResponseCallback callback = nullptr);
+    std::future<ofJson> getLocalThemeCount(long experienceId, ResponseCallback callback = nullptr);
+    std::future<ofJson> getLocalThemeCounts(ResponseCallback callback = nullptr);
+    std::future<ofJson> downloadUserPreferences(ResponseCallback callback = nullptr);
+    std::future<ofJson> uploadUserPreferences(ResponseCallback callback = nullptr);
+    std::future<ofJson> getUserPreference(const std::string& keyPath, ResponseCallback callback = nullptr);
+    ///@}
+
+    /**
+     * @brief Latest beat, tempo, section and per-group rms
+     *
+     * The snapshot is assembled on the worker thread from transport, rms and section messages as they
+     * arrive, and read here without locking or JSON parsing. Call from a single thread, typically update() or draw().
+     */
+    ofxLibamosSnapshot getSnapshot();
+
+    /**
+     * @name Message filtering and polling
+     * Filters apply to messages that do not answer a pending request. With no filters every message is passed on;
+     * otherwise only messages carrying at least one of the filter tags (e.g. "transport", "rms", "download") are.
+     * Filtered messages still update the snapshot.
+     */
+    ///@{
+    void addMessageFilter(const std::string& tag);
+    void removeMessageFilter(const std::string& tag);
+    void clearMessageFilters();
+
+    /**
+     * @brief Queue messages for pollMessages instead of only notifying messageReceived
+     *
+     * @param enabled Whether messages passing the filters are queued
+     * @param maxQueued Queue bound; when full the oldest message is dropped and counted
+     */
+    void setMessagePolling(bool enabled, size_t maxQueued = 1024);
+
+    /**
+     * @brief Move up to maxMessages queued messages, oldest first, onto the end of messages
+     *
+     * Takes the queue lock once per call, so it is cheap to call once per frame.
+     *
+     * @return the number of messages appended
+     */
+    size_t pollMessages(std::vector<ofJson>& messages, size_t maxMessages = SIZE_MAX);
+
+    /// Number of messages dropped because the poll queue was full
+    uint64_t getNumDroppedMessages() const;
+    ///@}
+
+    /// Notified on the worker thread with every message that does not answer a pending request and passes the filters
+    ofEvent<ofJson> messageReceived;
+
+private:
+    // A slot is free while id is 0. The requesting thread probes from the request's home slot for a
+    // free one, fills in promise, callback and issue time, then publishes the id. Whichever of the worker
+    // (with the response) or cancelRequestsOlderThan first swaps the id for CLAIMED_REQUEST takes promise
+    // and callback, then frees the slot. Each side only touches slots in the state the other side has
+    // handed over, so neither needs a lock.
+    struct PendingRequest {
+        std::atomic<long> id{0};
+        std::promise<ofJson> promise;
+        ResponseCallback callback;
+        std::chrono::steady_clock::time_point issued;
+    };
+
+    static const long CLAIMED_REQUEST = -1;
+
+    std::future<ofJson> request(const std::function<void(long)>& issue, ResponseCallback callback);
+    bool resolve(long requestId, const ofJson& response);
+    void abandonPendingRequests();
+    void stopWorker();
+    void updateSnapshot(const ofJson& msg);
+    bool passesFilters(const ofJson& msg);
+    void queueMessage(const ofJson& msg);
+    void threadedFunction();
+    void dispatch(const std::string& msg);
+
+    static void onAmosMessage(void* object, const char* msg);
+
+    std::array<PendingRequest, MAX_PENDING_REQUESTS> pending;
+    std::atomic<long> nextRequestId{1};
+    std::atomic<size_t> numPending{0};
+
+    ofxLibamosTripleBuffer<ofxLibamosSnapshot> snapshots;
+    ofxLibamosSnapshot latestSnapshot = {};
+
+    std::mutex filterMutex;
+    std::set<std::string> filterTags;
+
+    std::mutex pollMutex;
+    std::deque<ofJson> polled;
+    bool polling = false;
+    size_t maxPolled = 1024;
+    std::atomic<uint64_t> droppedMessages{0};
+
+    std::unique_ptr<ofThreadChannel<std::string>> incoming;
+    std::thread worker;
+    bool created = false;
+
+    static std::atomic<bool> instanceActive;
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "amos.h"
+
+#ifdef WITH_EXTERNAL_SINK
+
+/**
+ * @brief Output format variants of audioRender
+ * @details audioRender always produces interleaved 32-bit float stereo at 48kHz. The functions below
+ * render through audioRender in small chunks and convert each chunk while it is still in cache,
+ * so integrations no longer need a separate full-buffer conversion pass after rendering.
+ * Like audioRender itself, they must be called from the client's audio pull thread.
+ */
+
+/** Frames rendered per chunk. 512 stereo float frames (4kB) of scratch live on the stack. */
+#define OFXLIBAMOS_RENDER_CHUNK_FRAMES 512
+
+namespace ofxLibamosRenderDetail {
+
+// The clamp to [-1, 1] is written as 0.5 * (|x + 1| - |x - 1|) and rounding as adding +-0.5 before
+// truncating. Unlike comparisons or lrint, neither stops the compiler vectorising the conversion loops.
+inline int16_t toInt16(float x) {
+    float y = (std::fabs(x + 1.0f) - std::fabs(x - 1.0f)) * (0.5f * 32767.0f);
+    return (int16_t)(int32_t)(y + std::copysign(0.5f, y));
+}
+
+inline int32_t toInt32(float x) {
+    double d = x;
+    double y = (std::fabs(d + 1.0) - std::fabs(d - 1.0)) * (0.5 * 2147483647.0);
+    return (int32_t)(y + std::copysign(0.5, y));
+}
+
+// Renders frame_count frames through audioRender a chunk at a time, handing each interleaved
+// chunk to write(chunk, offset, frames). Returns the first non-zero audioRender result, after
+// writing silence for that chunk and every chunk after it.
+template <typename Writer>
+inline int renderChunked(unsigned int frame_count, Writer write) {
+    float chunk[2 * OFXLIBAMOS_RENDER_CHUNK_FRAMES];
+    unsigned int offset = 0;
+    while (offset < frame_count) {
+        unsigned int frames = frame_count - offset;
+        if (frames > OFXLIBAMOS_RENDER_CHUNK_FRAMES) frames = OFXLIBAMOS_RENDER_CHUNK_FRAMES;
+        int res = audioRender(chunk, frames);
+        if (res != 0) {
+            // Silence the rest of the output rather than leave the previous buffer's audio in it
+            std::fill(chunk, chunk + 2 * OFXLIBAMOS_RENDER_CHUNK_FRAMES, 0.0f);
+            while (offset < frame_count) {
+                frames = frame_count - offset;
+                if (frames > OFXLIBAMOS_RENDER_CHUNK_FRAMES) frames = OFXLIBAMOS_RENDER_CHUNK_FRAMES;
+                write(chunk, offset, frames);
+                offset += frames;
+            }
+            return res;
+        }
+        write(chunk, offset, frames);
+        offset += frames;
+    }
+    return 0;
+}
+
+} // namespace ofxLibamosRenderDetail
+
+
+/**
+ * @brief Request the next audio buffer from AMOS as planar (non-interleaved) float
+ *
+ * @param left A floating point buffer of frame_count samples for the left channel
+ * @param right A floating point buffer of frame_count samples for the right channel
+ * @param frame_count The number of frames to render
+ * @return int 0 on successful processing, otherwise the error code returned by audioRender
+ */
+inline int ofxLibamosRenderPlanar(float* left, float* right, unsigned int frame_count) {
+    return ofxLibamosRenderDetail::renderChunked(frame_count, [=](const float* chunk, unsigned int offset, unsigned int frames) {
+        float* __restrict l = left + offset;
+        float* __restrict r = right + offset;
+        for (unsigned int i = 0; i < frames; ++i) {
+            l[i] = chunk[2 * i];
+            r[i] = chunk[2 * i + 1];
+        }
+    });
+}
+
+
+/**
+ * @brief Request the next audio buffer from AMOS as interleaved signed 16-bit stereo
+ *
+ * Samples are clipped to [-1, 1] before scaling to the int16 range.
+ *
+ * @param buf An int16 audio data buffer of 2 * frame_count samples
+ * @param frame_count The number of frames to render
+ * @return int 0 on successful processing, otherwise the error code returned by audioRender
+ */
+inline int ofxLibamosRenderInt16(int16_t* buf, unsigned int frame_count) {
+    return ofxLibamosRenderDetail::renderChunked(frame_count, [=](const float* chunk, unsigned int offset, unsigned int frames) {
+        int16_t* __restrict out = buf + 2 * offset;
+        for (unsigned int i = 0; i < 2 * frames; ++i) {
+            out[i] = ofxLibamosRenderDetail::toInt16(chunk[i]);
+        }
+    });
+}
+
+
+/**
+ * @brief Request the next audio buffer from AMOS as interleaved signed 32-bit stereo
+ *
+ * Samples are clipped to [-1, 1] before scaling to the int32 range.
+ *
+ * @param buf An int32 audio data buffer of 2 * frame_count samples
+ * @param frame_count The number of frames to render
+ * @return int 0 on successful processing, otherwise the error code returned by audioRender
+ */
+inline int ofxLibamosRenderInt32(int32_t* buf, unsigned int frame_count) {
+    return ofxLibamosRenderDetail::renderChunked(frame_count, [=](const float* chunk, unsigned int offset, unsigned int frames) {
+        int32_t* __restrict out = buf + 2 * offset;
+        for (unsigned int i = 0; i < 2 * frames; ++i) {
+            out[i] = ofxLibamosRenderDetail::toInt32(chunk[i]);
+        }
+    });
+}
+
+#endif
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+/** Number of groups (aka tracks): 0 = Beats, 1 = Bass, 2 = Harmony, 3 = Pads, 4 = Tops, 5 = Melody, 6 = FX */
+#define OFXLIBAMOS_NUM_GROUPS 7
+
+/** Maximum length, including the terminator, of the section key held in a snapshot */
+#define OFXLIBAMOS_SECTION_KEY_SIZE 64
+
+/**
+ * @brief Latest engine state for visualisers
+ * @details Plain data, so it can be copied in one go. Fields are only updated while the corresponding
+ * messages are flowing: transport fields need amos_start_transport_msgs, rms needs amos_start_rms_msgs,
+ * and section is updated whenever a currently playing section response arrives.
+ */
+struct ofxLibamosSnapshot {
+    /// Incremented every time any field changes; 0 means nothing has been received yet
+    uint64_t sequence;
+
+    double beat;
+    double tempo;
+    double seconds;
+    int64_t frame;
+
+    /// Beat at which the rms values were taken
+    double rmsBeat;
+    float rms[OFXLIBAMOS_NUM_GROUPS];
+
+    char section[OFXLIBAMOS_SECTION_KEY_SIZE];
+};
+
+/**
+ * @brief Single-writer single-reader triple buffer
+ * @details The writer fills the back slot and swaps it with the middle one; the reader swaps the middle
+ * slot into the front if it holds something newer. Neither side ever waits, and the reader always sees
+ * a complete value.
+ */
+template <typename T>
+class ofxLibamosTripleBuffer {
+public:
+    ofxLibamosTripleBuffer() : slots(), state(1), front(2), back(0) {
+    }
+
+    /// Writer side: publish a new value
+    void write(const T& value) {
+        slots[back] = value;
+        unsigned char prev = state.exchange((unsigned char)(back | FRESH_BIT), std::memory_order_acq_rel);
+        back = prev & INDEX_MASK;
+    }
+
+    /// Reader side: the most recently published value
+    const T& read() {
+        if (state.load(std::memory_order_relaxed) & FRESH_BIT) {
+            unsigned char prev = state.exchange(front, std::memory_order_acq_rel);
+            front = prev & INDEX_MASK;
+        }
+        return slots[front];
+    }
+
+private:
+    static const unsigned char INDEX_MASK = 0x3;
+    static const unsigned char FRESH_BIT = 0x4;
+
+    T slots[3];
+    // Index of the middle slot, plus FRESH_BIT when it holds a value the reader has not seen
+    std::atomic<unsigned char> state;
+    unsigned char front;
+    unsigned char back;
+};
@@ -0,0 +1,167 @@
+#include "ofxLibamos.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#ifndef TARGET_WIN32
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#ifdef WITH_EXTERNAL_SINK
+
+namespace {
+    const double AMOS_SAMPLE_RATE = 48000.0;
+
+    // Render thread priority below the SCHED_FIFO maximum, so the sound stream's own I/O thread
+    // (and, on Linux, threaded IRQs) are never preempted by a full engine render
+    const int RENDER_PRIORITY_BELOW_MAX = 10;
+}
+
+ofxLibamosSoundOutput::ofxLibamosSoundOutput() {
+}
+
+ofxLibamosSoundOutput::~ofxLibamosSoundOutput() {
+    stop();
+}
+
+void ofxLibamosSoundOutput::setup(size_t streamBufferSize, int streamSampleRate, size_t renderBlockSize, size_t blocksAhead) {
+    stop();
+
+    ready = false;
+    while (activeReaders.load() != 0) {
+        std::this_thread::yield();
+    }
+
+    blockSize = std::max<size_t>(renderBlockSize, 1);
+    // One callback may consume this many 48kHz frames, plus one more for interpolation
+    double ratio = AMOS_SAMPLE_RATE / std::max(streamSampleRate, 1);
+    size_t perCallback = (size_t)std::ceil(streamBufferSize * ratio) + 1;
+    // Capacity is a whole number of blocks, so a block is always written contiguously
+    size_t callbackBlocks = (perCallback + blockSize - 1) / blockSize;
+    capacity = blockSize * (callbackBlocks + std::max<size_t>(blocksAhead, 1));
+    ring.assign(2 * capacity, 0.0f);
+    writePos = 0;
+    readPos = 0;
+    readPhase = 0.0;
+    underruns = 0;
+    lastRenderError = 0;
+
+    ready = true;
+    running = true;
+    renderThread = std::thread(&ofxLibamosSoundOutput::threadedFunction, this);
+
+#ifndef TARGET_WIN32
+    sched_param param;
+    param.sched_priority = std::max(sched_get_priority_max(SCHED_FIFO) - RENDER_PRIORITY_BELOW_MAX, sched_get_priority_min(SCHED_FIFO));
+    if (pthread_setschedparam(renderThread.native_handle(), SCHED_FIFO, &param) != 0) {
+        ofLogVerbose("ofxLibamosSoundOutput") << "setup(): could not raise render thread priority";
+    }
+#endif
+}
+
+void ofxLibamosSoundOutput::stop() {
+    running = false;
+    if (renderThread.joinable()) {
+        renderThread.join();
+    }
+}
+
+uint64_t ofxLibamosSoundOutput::getNumUnderruns() const {
+    return underruns.load(std::memory_order_relaxed);
+}
+
+size_t ofxLibamosSoundOutput::getNumBufferedFrames() const {
+    return writePos.load(std::memory_order_acquire) - readPos.load(std::memory_order_acquire);
+}
+
+int ofxLibamosSoundOutput::getLastRenderError() const {
+    return lastRenderError.load(std::memory_order_relaxed);
+}
+
+void ofxLibamosSoundOutput::threadedFunction() {
+    // Poll at a quarter of a block, which keeps the ring topped up without spinning
+    auto idle = std::chrono::microseconds((long long)(250000.0 * blockSize / AMOS_SAMPLE_RATE));
+
+    while (running) {
+        size_t write = writePos.load(std::memory_order_relaxed);
+        size_t read = readPos.load(std::memory_order_acquire);
+        if (capacity - (write - read) < blockSize) {
+            std::this_thread::sleep_for(idle);
+            continue;
+        }
+
+        float* block = &ring[2 * (write % capacity)];
+        int res = audioRender(block, (unsigned int)blockSize);
+        if (res != 0) {
+            lastRenderError = res;
+            std::fill(block, block + 2 * blockSize, 0.0f);
+        }
+        writePos.store(write + blockSize, std::memory_order_release);
+    }
+}
+
+size_t ofxLibamosSoundOutput::drainResampled(ofSoundBuffer& buffer, size_t available) {
+    size_t numFrames = buffer.getNumFrames();
+    size_t numChannels = buffer.getNumChannels();
+    size_t read = readPos.load(std::memory_order_relaxed);
+    double ratio = AMOS_SAMPLE_RATE / buffer.getSampleRate();
+
+    size_t i = 0;
+    for (; i < numFrames; ++i) {
+        size_t idx = (size_t)readPhase;
+        float left, right;
+        if (ratio == 1.0) {
+            if (idx >= available) break;
+            const float* a = &ring[2 * ((read + idx) % capacity)];
+            left = a[0];
+            right = a[1];
+        } else {
+            if (idx + 1 >= available) break;
+            float t = (float)(readPhase - idx);
+            const float* a = &ring[2 * ((read + idx) % capacity)];
+            const float* b = &ring[2 * ((read + idx + 1) % capacity)];
+            left = a[0] + t * (b[0] - a[0]);
+            right = a[1] + t * (b[1] - a[1]);
+        }
+
+        float* out = &buffer[i * numChannels];
+        if (numChannels == 1) {
+            out[0] = 0.5f * (left + right);
+        } else {
+            out[0] = left;
+            out[1] = right;
+            for (size_t c = 2; c < numChannels; ++c) {
+                out[c] = 0.0f;
+            }
+        }
+        readPhase += ratio;
+    }
+
+    // At ratio >= 2 readPhase can step past the last available frame; the excess carries over
+    size_t consumed = std::min((size_t)readPhase, available);
+    readPhase -= consumed;
+    readPos.store(read + consumed, std::memory_order_release);
+    return i;
+}
+
+void ofxLibamosSoundOutput::audioOut(ofSoundBuffer& buffer) {
+    size_t written = 0;
+    activeReaders.fetch_add(1);
+    if (ready.load()) {
+        size_t available = writePos.load(std::memory_order_acquire) - readPos.load(std::memory_order_relaxed);
+        written = drainResampled(buffer, available);
+    }
+    activeReaders.fetch_sub(1);
+
+    if (written < buffer.getNumFrames()) {
+        std::vector<float>& samples = buffer.getBuffer();
+        std::fill(samples.begin() + written * buffer.getNumChannels(), samples.end(), 0.0f);
+        if (running) {
+            underruns.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "ofMain.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "amos.h"
+
+#ifdef WITH_EXTERNAL_SINK
+
+/**
+ * @brief ofSoundStream output that plays AMOS with a render-ahead buffer
+ * @details Instead of calling audioRender from the sound stream callback, ofxLibamosSoundOutput renders
+ * on its own thread, renderBlockSize frames at a time, into a single-producer single-consumer ring.
+ * audioOut only copies out of the ring, so a slow engine cycle is absorbed by the queued blocks
+ * rather than heard as a glitch.
+ *
+ * The sound stream may use any buffer size, channel count or sample rate; pass its buffer size and
+ * rate to setup. The ring holds enough whole blocks for one callback, ceil(streamBufferSize * 48000 /
+ * streamSampleRate + 1) frames rounded up to a multiple of renderBlockSize, plus blocksAhead blocks on top.
+ * The render thread keeps the ring topped up to within one block of full, so that is also the
+ * steady-state latency: with the defaults and a 512-frame 48kHz stream, 3 + 4 blocks of 256 frames,
+ * 1792 frames or about 37ms. Each extra block ahead adds renderBlockSize frames of latency and of safety.
+ * Output at rates other than AMOS's 48kHz is resampled with linear interpolation while draining the
+ * ring. There is no anti-alias filter, so content above the stream's Nyquist frequency folds back:
+ * rates well below 48kHz, such as 22050 or 16000Hz, will audibly alias. If the ring runs dry the rest
+ * of the buffer is filled with silence and the underrun counter is incremented.
+ *
+ * Pass an instance to ofSoundStreamSettings::setOutListener after ofxLibamos::setup. setup may be
+ * called again while the stream is running: audioOut outputs silence while the ring is replaced.
+ *
+ * The render thread calls audioRender until stop is called, and nothing ties it to the ofxLibamos
+ * that created the engine. Call stop (or destroy this object) before ofxLibamos::close or the
+ * destruction of the ofxLibamos, otherwise audioRender runs on a destroyed engine. When both are
+ * members of the same class, declare the ofxLibamos first so that it is destroyed last.
+ */
+class ofxLibamosSoundOutput : public ofBaseSoundOutput {
+public:
+    ofxLibamosSoundOutput();
+    ~ofxLibamosSoundOutput();
+
+    ofxLibamosSoundOutput(const ofxLibamosSoundOutput&) = delete;
+    ofxLibamosSoundOutput& operator=(const ofxLibamosSoundOutput&) = delete;
+
+    /**
+     * @brief Allocate the ring and start the render thread
+     *
+     * @param streamBufferSize Frames per audioOut call, as in ofSoundStreamSettings::bufferSize
+     * @param streamSampleRate Sample rate of the sound stream, as in ofSoundStreamSettings::sampleRate
+     * @param renderBlockSize Number of frames passed to each audioRender call
+     * @param blocksAhead Number of blocks buffered beyond what one callback consumes
+     */
+    void setup(size_t streamBufferSize, int streamSampleRate, size_t renderBlockSize = 256, size_t blocksAhead = 4);
+
+    /// Stop the render thread. Subsequent audioOut calls output silence. Must be called before ofxLibamos::close.
+    void stop();
+
+    void audioOut(ofSoundBuffer& buffer) override;
+
+    /// Number of audioOut calls that could not be completely filled from the ring
+    uint64_t getNumUnderruns() const;
+
+    /// Frames currently rendered and waiting to be played, at 48kHz
+    size_t getNumBufferedFrames() const;
+
+    /// Most recent non-zero audioRender result, or 0 if every render succeeded
+    int getLastRenderError() const;
+
+private:
+    void threadedFunction();
+    size_t drainResampled(ofSoundBuffer& buffer, size_t available);
+
+    std::vector<float> ring;
+    size_t blockSize = 0;
+    size_t capacity = 0;
+
+    // Monotonic frame counters. writePos is only written by the render thread, readPos only by audioOut.
+    std::atomic<size_t> writePos{0};
+    std::atomic<size_t> readPos{0};
+    double readPhase = 0.0;
+
+    // audioOut only touches the ring while ready is set; setup clears it and waits for
+    // activeReaders to drain before replacing the ring, so audioOut itself never waits
+    std::atomic<bool> ready{false};
+    std::atomic<int> activeReaders{0};
+
+    std::atomic<bool> running{false};
+    std::atomic<uint64_t> underruns{0};
+    std::atomic<int> lastRenderError{0};
+    std::thread renderThread;
+};
+
+#endif